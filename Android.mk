@@ -10,6 +10,9 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := android-blob-utility.c
 
 LOCAL_CFLAGS += -DSYSTEM_DUMP_SDK_VERSION=$(SYSTEM_DUMP_SDK_VERSION)
+LOCAL_CFLAGS += -DUSE_ZLIB
+
+LOCAL_STATIC_LIBRARIES := libz
 
 LOCAL_MODULE := android-blob-utility
 
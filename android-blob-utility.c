@@ -32,13 +32,20 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef USE_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
 #endif
 
+struct zip_archive;
+
 bool dot_so_finder(char *filename);
-void check_emulator_for_lib(char *emulator_check);
+void check_emulator_for_blob(char *emulator_check, enum blob_kind kind);
+bool zip_bundles_lib(struct zip_archive *zip, char *lib);
 
 char system_dump_root[256] = SYSTEM_DUMP_ROOT;
 
@@ -46,11 +53,39 @@ char system_vendor[32] = SYSTEM_VENDOR;
 
 char system_device[32] = SYSTEM_DEVICE;
 
-char all_libs[ALL_LIBS_SIZE] = {0};
+char *all_libs;
+size_t all_libs_size;
+size_t all_libs_used;
 char *sdk_buffer;
 
 int sdk_version = SYSTEM_DUMP_SDK_VERSION;
 
+#define MAX_MATCHER_STATES 128
+
+/* Aho-Corasick automaton over blob_patterns, flattened into a full transition table so that
+ * scanning a blob costs one table lookup per byte no matter how many patterns there are.
+ */
+struct blob_matcher {
+    short next[MAX_MATCHER_STATES][256];
+    unsigned int output[MAX_MATCHER_STATES]; /* bitmask of the blob_patterns ending in this state */
+    int num_states;
+};
+
+struct blob_matcher matcher;
+
+struct zip_archive {
+    const unsigned char *map;
+    const unsigned char *end;
+    const unsigned char *central_directory;
+    unsigned int num_entries;
+};
+
+/* The apk or jar being scanned, if any, and the directory it sits in, relative to the dump root.
+ * The libraries it loads may be bundled inside it, or extracted into that directory.
+ */
+struct zip_archive *current_zip;
+char current_app_directory[MAX_BLOB_PATH];
+
 /* The purpose of this program is to help find proprietary libraries that are needed to
  * build AOSP-based ROMs. Running the top command on the stock ROM will help find proprietary
  * daemons that are started by the init*.rc scripts, and are normally-located in /system/bin/
@@ -95,41 +130,73 @@ bool char_is_valid(char *s) {
     return false;
 }
 
+/* Same as char_is_valid, but for firmware, config and script references, which may carry a
+ * directory and dots in their names ("/system/etc/firmware/a300_pm4.fw.bin"), but no wildcards.
+ */
+
+bool char_is_path_valid(char *s) {
+
+    if (*s == '.' || *s == '/')
+        return true;
+    if (*s == 0 || *s == '%')
+        return false;
+    return char_is_valid(s);
+}
+
 /* No need to print out libdiag.so 100 times, so if it's the first time, add it to the list
- * of libraries that we have found that are missing and be done with it.
+ * of libraries that we have found that are missing and be done with it. Only whole entries
+ * count, otherwise "/etc/thermal.conf" would be skipped as soon as "/vendor/etc/thermal.conf"
+ * has been processed.
  */
 
 bool check_if_repeat(char *lib) {
 
-    if (memmem(all_libs, ALL_LIBS_SIZE, lib, strlen(lib))) {
-        /* fprintf(stderr, "skipping %s!!\n", lib); */
-        return true;
+    char *hit = all_libs;
+    size_t len = strlen(lib);
+
+    if (!all_libs)
+        return false;
+
+    while ((hit = memmem(hit, all_libs + all_libs_used - hit, lib, len)) != NULL) {
+        if ((hit == all_libs || *(hit - 1) == '\0') && hit + len < all_libs + all_libs_used &&
+                hit[len] == '\0') {
+            /* fprintf(stderr, "skipping %s!!\n", lib); */
+            return true;
+        }
+        hit++;
     }
     return false;
 }
 
 /* If it's the first time a library is found, add it do the repository of libraries that
  * have been mentioned. There is no need to keep spitting out the same library 100 times
- * if it's needed by multiple libraries.
+ * if it's needed by multiple libraries. The repository doubles in size whenever it fills up,
+ * as dropping entries would let libraries which need each other recurse forever.
  */
 
 void mark_lib_as_processed(char *lib) {
 
-    static int offset = 0;
-#ifdef DEBUG
-    const char *save = lib;
-#endif
-
-    while (*lib) {
-        all_libs[offset] = *lib;
-        offset++;
-        lib++;
+    size_t len = strlen(lib) + 1;
+    size_t new_size;
+    char *new_libs;
+
+    if (all_libs_used + len > all_libs_size) {
+        new_size = all_libs_size ? all_libs_size : ALL_LIBS_SIZE;
+        while (all_libs_used + len > new_size)
+            new_size *= 2;
+        new_libs = realloc(all_libs, new_size);
+        if (!new_libs) {
+            fprintf(stderr, "Out of memory, exiting!\n");
+            exit(1);
+        }
+        all_libs = new_libs;
+        all_libs_size = new_size;
     }
-    offset++;
-    if (offset > ALL_LIBS_SIZE - 100)
-        fprintf(stderr, "You may need to increase the ALL_LIBS_SIZE macro.\n");
+
+    memcpy(all_libs + all_libs_used, lib, len);
+    all_libs_used += len;
 #ifdef DEBUG
-    fprintf(stderr, "Added: %s %d\n", save, offset);
+    fprintf(stderr, "Added: %s %zu\n", lib, all_libs_used);
 #endif
 }
 
@@ -182,6 +249,37 @@ bool build_prop_checker(void) {
     return false;
 }
 
+/* Libraries, firmware, configs and scripts each live in their own set of directories, except for
+ * absolute references, which we already know the exact location of.
+ */
+
+const char **get_blob_directories(char *name, enum blob_kind kind) {
+
+    if (*name == '/')
+        return absolute_directories;
+    return blob_kind_directories[kind];
+}
+
+/* Since Lollipop, apps live in a directory of their own, /system/app/Foo/Foo.apk rather than
+ * /system/app/Foo.apk, so a bare "Foo.apk" also has to be looked for under "Foo/". Returns
+ * false when there is no such subdirectory to try.
+ */
+
+bool get_blob_subdirectory(char *name, enum blob_kind kind, char *subdirectory) {
+
+    char *dot;
+
+    if (kind != BLOB_APP || strchr(name, '/'))
+        return false;
+
+    dot = strrchr(name, '.');
+    if (!dot || dot == name || dot - name + 2 > MAX_BLOB_PATH)
+        return false;
+
+    sprintf(subdirectory, "%.*s/", (int)(dot - name), name);
+    return true;
+}
+
 /* See if the filename in the /system dump matches a file in the SDK version's emulator dump.
  * if it is not in the emulator's dump, it means it's a proprietary or must be built from source
  * in order for the library of daemon to run.
@@ -220,7 +318,7 @@ bool find_wildcard_libraries(char *beginning, char *end) {
 
         while ((dirent = readdir(dir)) != NULL) {
             if (strstr(dirent->d_name, beginning) && strstr(dirent->d_name, end)) {
-                check_emulator_for_lib(dirent->d_name);
+                check_emulator_for_blob(dirent->d_name, BLOB_LIB);
                 found = true;
             }
         }
@@ -235,7 +333,7 @@ bool find_wildcard_libraries(char *beginning, char *end) {
 /* This function will split the wildcard library name into two parts; the beginning part,
  * and the end part. The wildcard string 'libmmcamera_%s.so' will be split into "libmmcamera_"
  * and ".so", then passed to find_wildcard_libraries, where that function will search for libraries
- * beginning with "libmmcamera_", and ending with ".so" and pass its hits over check_emulator_for_lib.
+ * beginning with "libmmcamera_", and ending with ".so" and pass its hits over check_emulator_for_blob.
  */
 
 bool process_wildcard(char *wildcard) {
@@ -263,19 +361,77 @@ bool process_wildcard(char *wildcard) {
  * to, instead of silently failing without ever mentioning it
  */
 
-bool get_lib_from_system_dump(char *system_check) {
+/* Print and scan system_check if the system dump has it in directory. found_hit is set when it
+ * does, or when there is nothing there worth complaining about.
+ */
+
+void get_blob_from_directory(const char *directory, char *system_check, enum blob_kind kind,
+        bool *found_hit) {
 
-    int i;
     char system_dump_path_to_blob[256];
+    char blob_path[256];
+    struct stat blob_stat;
+
+    sprintf(system_dump_path_to_blob, "%s%s%s", system_dump_root, directory, system_check);
+    if (stat(system_dump_path_to_blob, &blob_stat))
+        return;
+
+    /* binaries are full of "/system/etc/wifi" and the like, which are directories
+     * rather than blobs, so there is nothing to copy and nothing to warn about.
+     */
+    if (S_ISDIR(blob_stat.st_mode)) {
+        *found_hit = true;
+        return;
+    }
+
+    /* "thermal.conf" and "/system/vendor/etc/thermal.conf" are the same blob, so keep
+     * track of where bare names resolved to as well. Absolute names already are.
+     */
+    if (*directory) {
+        sprintf(blob_path, "%s%s", directory, system_check);
+        if (check_if_repeat(blob_path)) {
+            *found_hit = true;
+            return;
+        }
+        mark_lib_as_processed(blob_path);
+    }
+
+    printf("vendor/%s/%s/proprietary%s%s:system%s%s \\\n", system_vendor, system_device,
+            directory, system_check, directory, system_check);
+
+    /* firmware images are loaded by the kernel or a coprocessor, they don't go looking for
+     * other blobs, and scanning them only turns up garbage.
+     */
+    if (kind == BLOB_FIRMWARE)
+        *found_hit = true;
+    else
+        *found_hit = dot_so_finder(system_dump_path_to_blob);
+}
+
+bool get_blob_from_system_dump(char *system_check, enum blob_kind kind) {
+
+    int i, j;
+    const char **directories;
+    const char *subdirectories[] = { "", NULL, NULL };
+    char subdirectory[MAX_BLOB_PATH];
+    char directory[256];
     bool found_hit = false;
 
-    for (i = 0; blob_directories[i]; i++) {
-        sprintf(system_dump_path_to_blob, "%s%s%s", system_dump_root, blob_directories[i],
-                system_check);
-        if (!access(system_dump_path_to_blob, F_OK)) {
-            printf("vendor/%s/%s/proprietary%s%s:system%s%s \\\n", system_vendor, system_device,
-                    blob_directories[i], system_check, blob_directories[i], system_check);
-            found_hit = dot_so_finder(system_dump_path_to_blob);
+    directories = get_blob_directories(system_check, kind);
+    if (get_blob_subdirectory(system_check, kind, subdirectory))
+        subdirectories[1] = subdirectory;
+
+    for (i = 0; directories[i]; i++) {
+        for (j = 0; subdirectories[j]; j++) {
+            sprintf(directory, "%s%s", directories[i], subdirectories[j]);
+            get_blob_from_directory(directory, system_check, kind, &found_hit);
+        }
+    }
+
+    if (kind == BLOB_LIB && *current_app_directory && !strchr(system_check, '/')) {
+        for (i = 0; app_lib_directories[i]; i++) {
+            sprintf(directory, "%s%s", current_app_directory, app_lib_directories[i]);
+            get_blob_from_directory(directory, system_check, kind, &found_hit);
         }
     }
 
@@ -289,29 +445,59 @@ bool get_lib_from_system_dump(char *system_check) {
         return process_wildcard(system_check);
     }
 
+    /* from Marshmallow on, an app can load the libraries it bundles straight out of the apk, so
+     * there doesn't need to be a copy anywhere in /system. Before that, there has to be one.
+     */
+    if (!found_hit && kind == BLOB_LIB && sdk_version >= 23 && current_zip &&
+            zip_bundles_lib(current_zip, system_check)) {
+#ifdef DEBUG
+        fprintf(stderr, "%s is bundled in the apk\n", system_check);
+#endif
+        return true;
+    }
+
     if (!found_hit)
-        fprintf(stderr, "warning: blob file %s missing or broken\n", system_check);
+        fprintf(stderr, "warning: %s file %s missing or broken\n", blob_kind_names[kind], system_check);
     return found_hit;
 }
 
-/* We scan through the emulator's library directories and see if there's a hit. If there is,
- * we don't display anything. If there is no hit, we hand it over to the function called
- * get_lib_from_system_dump.
+/* We scan through the emulator's directories for that kind of blob and see if there's a hit.
+ * If there is, we don't display anything. If there is no hit, we hand it over to the function
+ * called get_blob_from_system_dump.
  */
 
-void check_emulator_for_lib(char *emulator_check) {
+void check_emulator_for_blob(char *emulator_check, enum blob_kind kind) {
 
     char emulator_full_path[256];
-    int i;
+    const char **directories;
+    const char *subdirectories[] = { "", NULL, NULL };
+    char subdirectory[MAX_BLOB_PATH];
+    int i, j;
 
     if (check_if_repeat(emulator_check))
         return;
 
-    for (i = 0; blob_directories[i]; i++) {
-        sprintf(emulator_full_path, "/system%s%s", blob_directories[i], emulator_check);
-        /* don't do anything if the file is in the emulator, as that means it's not proprietary. */
-        if (check_emulator_files_for_match(emulator_full_path))
-            return;
+    directories = get_blob_directories(emulator_check, kind);
+    if (get_blob_subdirectory(emulator_check, kind, subdirectory))
+        subdirectories[1] = subdirectory;
+
+    for (i = 0; directories[i]; i++) {
+        for (j = 0; subdirectories[j]; j++) {
+            sprintf(emulator_full_path, "/system%s%s%s", directories[i], subdirectories[j],
+                    emulator_check);
+            /* don't do anything if the file is in the emulator, as that means it's not proprietary. */
+            if (check_emulator_files_for_match(emulator_full_path))
+                return;
+        }
+    }
+
+    if (kind == BLOB_LIB && *current_app_directory && !strchr(emulator_check, '/')) {
+        for (i = 0; app_lib_directories[i]; i++) {
+            sprintf(emulator_full_path, "/system%s%s%s", current_app_directory,
+                    app_lib_directories[i], emulator_check);
+            if (check_emulator_files_for_match(emulator_full_path))
+                return;
+        }
     }
 
     mark_lib_as_processed(emulator_check); /* mark the library as processed */
@@ -319,7 +505,7 @@ void check_emulator_for_lib(char *emulator_check) {
     /* if we've made it this far, the blob is NOT in the emulator so that means it is proprietary
      * or an obsolete reference to a blob that is not even in the system dump.
      */
-    get_lib_from_system_dump(emulator_check);
+    get_blob_from_system_dump(emulator_check, kind);
 }
 
 /* After receiving a pointer to a location of memory that contains the string ".so" and
@@ -328,7 +514,7 @@ void check_emulator_for_lib(char *emulator_check) {
  * "lib" or in rare cases "egl" (eglsubAndroid.so) and break out of the loop once we find
  * a match. We save the pointer to the period ".so", and add 3. Then we subtract that location
  * in memory from the instance of "lib" or "egl" so that value is the entire length of the lib
- * | lib_whatever.so | then strncpy the value into "full_name", and pass it to the check_emulator_for_lib
+ * | lib_whatever.so | then strncpy the value into "full_name", and pass it to the check_emulator_for_blob
  * method which will search through the libraries directories of the emulator to see if there's
  * a library with that name that matches the one sent by get_full_lib_name. If it's missing, it means
  * that the library referenced is *not* in the emulator, which means:
@@ -354,7 +540,7 @@ void check_emulator_for_lib(char *emulator_check) {
  * "Completed successfully." will fail to appear.
  */
 
-void get_full_lib_name(char *found_lib) {
+void get_full_lib_name(char *found_lib, char *map_start) {
 
     char *ptr, *peek;
 
@@ -370,7 +556,8 @@ void get_full_lib_name(char *found_lib) {
     /* if there's a false-positive in finding matching ".so", but it isn't ever referencing
      * a library, it's probably just instructions that slipped through the cracks. In this case
      * we will rewind the pointer that's searching for "lib" or "egl" MAX_LIB_NAME (default 50)
-     * times, in which we will bail out citing that it was probably a false-positive
+     * times, in which we will bail out citing that it was probably a false-positive. Neither
+     * rewind goes past map_start, as the blob may be a buffer of its own, not just a mapping.
      */
     for (num_chars = 0; num_chars <= MAX_LIB_NAME; num_chars++) {
         if (!strncmp(ptr, egl_beginning, strlen(egl_beginning)) || !strncmp(ptr, lib_beginning, strlen(lib_beginning))) {
@@ -379,7 +566,7 @@ void get_full_lib_name(char *found_lib) {
              * "/system/lib/lib_whatever.so", because it would now point to lib/lib_whatever.so
              * which is not what what we want, so take the first pick if the peek character is '/'
              */
-            if (*peek == '/') {
+            if (ptr > map_start && *peek == '/') {
                 for (i = 0; blob_directories[i]; i++) {
                     if (!strncmp(peek, blob_directories[i], strlen(blob_directories[i]))) {
                         peek += strlen(blob_directories[i]);
@@ -397,7 +584,7 @@ void get_full_lib_name(char *found_lib) {
              * the original one, so we will get the entire library name of "libmmcamera_wavelet_lib.so"
              * and not just "lib.so" which would have been chosen if not for the peek.
              */
-            while (char_is_valid(peek) && *peek--) {
+            while (peek > map_start && char_is_valid(peek) && *peek--) {
                 if (!strncmp(peek, lib_beginning, strlen(lib_beginning))) {
 #ifdef DEBUG
                     fprintf(stderr, "Possible lib_lib.so! %s\n", peek);
@@ -418,22 +605,735 @@ void get_full_lib_name(char *found_lib) {
 #endif
             return;
         }
+        if (ptr == map_start)
+            return;
         ptr--;
         peek--;
     }
     len = (long)(found_lib + strlen(lib_beginning)) - (long)ptr;
     strncpy(full_name, ptr, len);
 
-    check_emulator_for_lib(full_name);
+    check_emulator_for_blob(full_name, BLOB_LIB);
+}
+
+/* Firmware, configs and scripts are referenced either by bare name ("modem.mbn"), in which case
+ * they are looked up in the directories for their kind, or by absolute path. Absolute paths are
+ * only worth resolving when they point into /system (or its /etc and /vendor aliases), so strip
+ * the "/system" part off, as every directory we print is relative to it. Anything in one of the
+ * firmware directories is firmware, whatever it ends with (a300_pfp.fw, modem.mdt, modem.b01).
+ */
+
+void resolve_blob_reference(char *name, enum blob_kind kind) {
+
+    int i;
+
+    if (*name == '/') {
+        if (!strncmp(name, "/system/", strlen("/system/")))
+            memmove(name, name + strlen("/system"), strlen(name + strlen("/system")) + 1);
+        else if (strncmp(name, "/etc/", strlen("/etc/")) && strncmp(name, "/vendor/", strlen("/vendor/")))
+            return;
+
+        for (i = 0; firmware_directories[i]; i++) {
+            if (!strncmp(name, firmware_directories[i], strlen(firmware_directories[i])))
+                kind = BLOB_FIRMWARE;
+        }
+    }
+
+#ifdef DEBUG
+    fprintf(stderr, "Found %s reference: %s\n", blob_kind_names[kind], name);
+#endif
+    check_emulator_for_blob(name, kind);
+}
+
+/* Work out which kind of blob a full path refers to by its ending, falling back to BLOB_ETC for
+ * anything under /system/etc that none of the suffixes cover.
+ */
+
+enum blob_kind classify_blob_name(char *name) {
+
+    size_t name_len, pattern_len;
+    int i;
+
+    name_len = strlen(name);
+    for (i = 0; blob_patterns[i].pattern; i++) {
+        if (blob_patterns[i].prefix)
+            continue;
+        pattern_len = strlen(blob_patterns[i].pattern);
+        if (name_len > pattern_len && !strcmp(name + name_len - pattern_len, blob_patterns[i].pattern))
+            return blob_patterns[i].kind;
+    }
+    return BLOB_ETC;
+}
+
+/* Counterpart of get_full_lib_name for the other suffixes: rewind from the suffix to the start of
+ * the name (or path), making sure the suffix actually ends the name, as ".bin" in "/dev/binder"
+ * or ".conf" in ".config" aren't references to anything. Format strings such as "%s.bin" are
+ * skipped, since we have no idea what gets filled in at runtime.
+ */
+
+void get_full_blob_name(char *found, const struct blob_pattern *pattern, char *map_start, char *map_end) {
+
+    char full_name[MAX_BLOB_PATH + 1] = {0};
+    char *start, *end;
+
+    end = found + strlen(pattern->pattern);
+    if (end < map_end && char_is_path_valid(end))
+        return;
+
+    start = found;
+    while (start > map_start && end - start < MAX_BLOB_PATH && char_is_path_valid(start - 1))
+        start--;
+
+    if (start == found || (start > map_start && *(start - 1) == '%'))
+        return;
+    if (end - start >= MAX_BLOB_PATH)
+        return;
+
+    strncpy(full_name, start, end - start);
+    resolve_blob_reference(full_name, pattern->kind);
+}
+
+/* Prefix patterns start a path, so walk forward to find the end of it. Libraries are left to
+ * get_full_lib_name, as their ".so" gets matched all the same.
+ */
+
+void get_full_blob_path(char *found, char *map_end) {
+
+    char full_name[MAX_BLOB_PATH + 1] = {0};
+    enum blob_kind kind;
+    char *end;
+
+    end = found;
+    while (end < map_end && end - found < MAX_BLOB_PATH && char_is_path_valid(end))
+        end++;
+
+    if (end - found >= MAX_BLOB_PATH || (end < map_end && *end == '%'))
+        return;
+
+    strncpy(full_name, found, end - found);
+    if (full_name[end - found - 1] == '/') /* just a directory */
+        return;
+
+    kind = classify_blob_name(full_name);
+    if (kind == BLOB_LIB)
+        return;
+
+    resolve_blob_reference(full_name, kind);
 }
 
-/* Purpose of this method is to open the library, by mmap-ing it, and traversing until it
- * until it finds ".so", (the ending of most Linux library names.) and then it will hand
- * it to the get_full_lib_name method. The "prepeek" pointer checks to make sure that the
- * character before the period in ".so" is a valid character (defined at the bottom of the
- * source) to cut down on false-positives where random binary-file junk just-so-happens to
- * have a random "][#$@#FW@&&.+^.so" laying around that doesn't pertain to a library, and
- * is just normal binary-file instructions and whatnot.
+/* Build the Aho-Corasick automaton for blob_patterns. Missing transitions are filled in from
+ * the failure links as we go breadth-first, so the scanner never has to follow a failure link
+ * itself, and each state's output also carries the output of its failure state, so a state
+ * reports every pattern that ends there (".so" inside "/system/etc/foo.so" and the like).
+ */
+
+void build_blob_matcher(void) {
+
+    int queue[MAX_MATCHER_STATES];
+    int fail[MAX_MATCHER_STATES] = {0};
+    int head = 0, tail = 0;
+    int state, child, i, c;
+    const unsigned char *p;
+
+    memset(matcher.next, -1, sizeof(matcher.next));
+    memset(matcher.output, 0, sizeof(matcher.output));
+    matcher.num_states = 1;
+
+    for (i = 0; blob_patterns[i].pattern; i++) {
+        if (i >= (int)(sizeof(matcher.output[0]) * 8)) {
+            fprintf(stderr, "Too many blob patterns, ignoring %s\n", blob_patterns[i].pattern);
+            break;
+        }
+        state = 0;
+        for (p = (const unsigned char *)blob_patterns[i].pattern; *p; p++) {
+            if (matcher.next[state][*p] == -1) {
+                if (matcher.num_states == MAX_MATCHER_STATES) {
+                    fprintf(stderr, "You may need to increase the MAX_MATCHER_STATES macro.\n");
+                    exit(1);
+                }
+                matcher.next[state][*p] = matcher.num_states++;
+            }
+            state = matcher.next[state][*p];
+        }
+        matcher.output[state] |= 1u << i;
+    }
+
+    for (c = 0; c < 256; c++) {
+        if (matcher.next[0][c] == -1) {
+            matcher.next[0][c] = 0;
+        } else {
+            fail[matcher.next[0][c]] = 0;
+            queue[tail++] = matcher.next[0][c];
+        }
+    }
+
+    while (head < tail) {
+        state = queue[head++];
+        matcher.output[state] |= matcher.output[fail[state]];
+        for (c = 0; c < 256; c++) {
+            child = matcher.next[state][c];
+            if (child == -1) {
+                matcher.next[state][c] = matcher.next[fail[state]][c];
+            } else {
+                fail[child] = matcher.next[fail[state]][c];
+                queue[tail++] = child;
+            }
+        }
+    }
+}
+
+/* Run a blob through the blob_matcher once, which finds every ".so" (the ending of most Linux
+ * library names) as well as every firmware, config, script and app suffix and "/system/etc/" path
+ * in that same pass. Each ".so" is handed to the get_full_lib_name method, the rest to
+ * get_full_blob_name or get_full_blob_path. For libraries, we check to make sure that the
+ * character before the period in ".so" is a valid character to cut down on false-positives where
+ * random binary-file junk just-so-happens to have a random "][#$@#FW@&&.+^.so" laying around that
+ * doesn't pertain to a library, and is just normal binary-file instructions and whatnot.
+ */
+
+void scan_blob_buffer(char *start, char *end) {
+
+    char *ptr;
+    char *found;
+    unsigned int output;
+    int state = 0;
+    int i;
+
+    if (!matcher.num_states)
+        build_blob_matcher();
+
+    for (ptr = start; ptr < end; ptr++) {
+        state = matcher.next[state][(unsigned char)*ptr];
+        output = matcher.output[state];
+        if (!output)
+            continue;
+
+        for (i = 0; output; i++, output >>= 1) {
+            if (!(output & 1))
+                continue;
+            found = ptr + 1 - strlen(blob_patterns[i].pattern);
+            if (blob_patterns[i].prefix)
+                get_full_blob_path(found, end);
+            else if (blob_patterns[i].kind == BLOB_LIB) {
+                if (found > start && char_is_valid(found - 1))
+                    get_full_lib_name(found, start);
+            } else
+                get_full_blob_name(found, &blob_patterns[i], start, end);
+        }
+    }
+}
+
+/* Both zip and dex files are little-endian, and nothing in them is guaranteed to be aligned */
+
+unsigned int read_le16(const unsigned char *p) {
+
+    return p[0] | (p[1] << 8);
+}
+
+unsigned int read_le32(const unsigned char *p) {
+
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+unsigned int read_uleb128(const unsigned char **p, const unsigned char *end) {
+
+    unsigned int value = 0;
+    int shift;
+
+    for (shift = 0; *p < end && shift < 35; shift += 7) {
+        value |= (unsigned int)(**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80))
+            break;
+    }
+    return value;
+}
+
+int read_sleb128(const unsigned char **p, const unsigned char *end) {
+
+    unsigned int value = 0;
+    int shift;
+    unsigned char byte = 0;
+
+    for (shift = 0; *p < end && shift < 35; shift += 7) {
+        byte = *(*p)++;
+        value |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            shift += 7;
+            break;
+        }
+    }
+    if (shift < 32 && (byte & 0x40))
+        value |= ~0u << shift;
+    return (int)value;
+}
+
+/* Look up string number idx in the dex string pool. Strings are MUTF-8, which is plain ASCII for
+ * anything that could be a library name, preceded by their uleb128 length in UTF-16 code units.
+ */
+
+const char *get_dex_string(const unsigned char *dex, size_t size, unsigned int idx) {
+
+    unsigned int string_ids_size, string_ids_off, data_off;
+    const unsigned char *p;
+
+    string_ids_size = read_le32(dex + 56);
+    string_ids_off = read_le32(dex + 60);
+    if (idx >= string_ids_size || string_ids_off + (size_t)idx * 4 + 4 > size)
+        return NULL;
+
+    data_off = read_le32(dex + string_ids_off + idx * 4);
+    if (data_off >= size)
+        return NULL;
+
+    p = dex + data_off;
+    read_uleb128(&p, dex + size);
+    if (!memchr(p, 0, dex + size - p))
+        return NULL;
+    return (const char *)p;
+}
+
+/* Find the method_id of System.loadLibrary in this dex. A dex only has one if it actually calls
+ * it, so most of them bail out here without looking at any code at all.
+ */
+
+long find_dex_load_library(const unsigned char *dex, size_t size) {
+
+    unsigned int type_ids_size, type_ids_off, method_ids_size, method_ids_off;
+    unsigned int i, class_idx;
+    const unsigned char *method_id;
+    const char *s;
+
+    type_ids_size = read_le32(dex + 64);
+    type_ids_off = read_le32(dex + 68);
+    method_ids_size = read_le32(dex + 88);
+    method_ids_off = read_le32(dex + 92);
+    if (type_ids_off + (size_t)type_ids_size * 4 > size ||
+            method_ids_off + (size_t)method_ids_size * 8 > size)
+        return -1;
+
+    for (i = 0; i < method_ids_size; i++) {
+        method_id = dex + method_ids_off + i * 8;
+        s = get_dex_string(dex, size, read_le32(method_id + 4));
+        if (!s || strcmp(s, load_library_method))
+            continue;
+        class_idx = read_le16(method_id);
+        if (class_idx >= type_ids_size)
+            continue;
+        s = get_dex_string(dex, size, read_le32(dex + type_ids_off + class_idx * 4));
+        if (s && !strcmp(s, load_library_class))
+            return i;
+    }
+    return -1;
+}
+
+/* System.loadLibrary("foo") wants libfoo.so, so put the "lib" and ".so" back on the name and
+ * treat it like any other library reference.
+ */
+
+void resolve_load_library(const char *name) {
+
+    char full_name[MAX_LIB_NAME + 8] = {0};
+    const char *p;
+
+    if (!*name || strlen(name) > MAX_LIB_NAME)
+        return;
+    for (p = name; *p; p++) {
+        if (*p == '%' || !char_is_valid((char *)p))
+            return;
+    }
+
+    sprintf(full_name, "%s%s%s", lib_beginning, name, lib_ending);
+#ifdef DEBUG
+    fprintf(stderr, "Found loadLibrary(\"%s\")\n", name);
+#endif
+    check_emulator_for_blob(full_name, BLOB_LIB);
+}
+
+/* Width of the instruction at insns[k] in code units. Payloads for packed-switch, sparse-switch
+ * and fill-array-data sit in the middle of the code as pseudo-instructions starting with a nop,
+ * and carry their own size.
+ */
+
+size_t get_dex_insn_width(const unsigned char *insns, unsigned int k, unsigned int insns_size) {
+
+    unsigned int unit = read_le16(insns + k * 2);
+
+    if (unit == 0x0100 && k + 2 <= insns_size) /* packed-switch-payload */
+        return 4 + (size_t)read_le16(insns + (k + 1) * 2) * 2;
+    if (unit == 0x0200 && k + 2 <= insns_size) /* sparse-switch-payload */
+        return 2 + (size_t)read_le16(insns + (k + 1) * 2) * 4;
+    if (unit == 0x0300 && k + 4 <= insns_size) /* fill-array-data-payload */
+        return 4 + ((size_t)read_le16(insns + (k + 1) * 2) * read_le32(insns + (k + 2) * 2) + 1) / 2;
+    return dex_insn_widths[unit & 0xff];
+}
+
+/* Step through a method's code one instruction at a time, remembering which string each register
+ * was last loaded with by const-string (or const-string/jumbo), and forgetting it as soon as
+ * something else is written there. When invoke-static {vX}, System.loadLibrary (or its /range
+ * form) comes along, vX holds the library name. That's what javac and d8 emit for
+ * System.loadLibrary("foo"), and anything smarter than that (names built at runtime) can't be
+ * known without running the app anyway.
+ */
+
+void scan_dex_insns(const unsigned char *dex, size_t size, const unsigned char *insns,
+        unsigned int insns_size, unsigned int method) {
+
+    long strings[256];
+    unsigned int k, unit, op, reg;
+    size_t width;
+    const char *s;
+
+    for (reg = 0; reg < 256; reg++)
+        strings[reg] = -1;
+
+    for (k = 0; k < insns_size; k += width) {
+        width = get_dex_insn_width(insns, k, insns_size);
+        if (width > insns_size - k)
+            return;
+
+        unit = read_le16(insns + k * 2);
+        op = unit & 0xff;
+
+        if ((op == 0x71 || op == 0x77) && read_le16(insns + (k + 1) * 2) == method) {
+            reg = 256;
+            if (op == 0x71 && (unit >> 12) == 1) /* invoke-static {vC}, meth@BBBB */
+                reg = read_le16(insns + (k + 2) * 2) & 0xf;
+            else if (op == 0x77 && (unit >> 8) == 1) /* invoke-static/range {vCCCC}, meth@BBBB */
+                reg = read_le16(insns + (k + 2) * 2);
+            if (reg < 256 && strings[reg] >= 0) {
+                s = get_dex_string(dex, size, strings[reg]);
+                if (s)
+                    resolve_load_library(s);
+            }
+            continue;
+        }
+
+        switch (dex_insn_dests[op]) {
+        case 1:
+            strings[(unit >> 8) & 0xf] = -1;
+            break;
+        case 2:
+            strings[unit >> 8] = -1;
+            break;
+        case 3:
+            reg = read_le16(insns + (k + 1) * 2);
+            if (reg < 256)
+                strings[reg] = -1;
+            break;
+        }
+
+        if (op == 0x1a) /* const-string vAA, string@BBBB */
+            strings[unit >> 8] = read_le16(insns + (k + 1) * 2);
+        else if (op == 0x1b) /* const-string/jumbo vAA, string@BBBBBBBB */
+            strings[unit >> 8] = read_le32(insns + (k + 1) * 2);
+    }
+}
+
+/* Walk every code_item in the dex, which the map_list tells us are laid out back to back, 4-byte
+ * aligned, so there is no need to go through the class definitions to find them. Anything that
+ * doesn't add up is treated as the end of the dex rather than trusted.
+ */
+
+void dex_load_library_finder(const unsigned char *dex, size_t size) {
+
+    const unsigned char *end = dex + size;
+    const unsigned char *p, *insns;
+    unsigned int map_off, map_size, code_count = 0, code_off = 0;
+    unsigned int i, tries_size, insns_size, handlers, pairs;
+    int catches;
+    long method;
+
+    if (size < 0x70 || memcmp(dex, "dex\n", 4)) {
+        fprintf(stderr, "warning: dex file is broken, skipping\n");
+        return;
+    }
+
+    method = find_dex_load_library(dex, size);
+    if (method < 0 || method > 0xffff)
+        return;
+
+    map_off = read_le32(dex + 52);
+    if ((size_t)map_off + 4 > size)
+        return;
+    map_size = read_le32(dex + map_off);
+    if (map_size > (size - map_off - 4) / 12)
+        return;
+    for (i = 0; i < map_size; i++) {
+        p = dex + map_off + 4 + i * 12;
+        if (read_le16(p) == 0x2001) { /* TYPE_CODE_ITEM */
+            code_count = read_le32(p + 4);
+            code_off = read_le32(p + 8);
+            break;
+        }
+    }
+    if (code_off >= size)
+        return;
+
+    p = dex + code_off;
+    for (i = 0; i < code_count; i++) {
+        p = dex + ((p - dex + 3) & ~3);
+        if (p + 16 > end)
+            return;
+        tries_size = read_le16(p + 6);
+        insns_size = read_le32(p + 12);
+        insns = p + 16;
+        if (insns_size > (size_t)(end - insns) / 2)
+            return;
+
+        scan_dex_insns(dex, size, insns, insns_size, method);
+
+        p = insns + insns_size * 2;
+        if (tries_size) {
+            if (insns_size & 1)
+                p += 2; /* padding */
+            if ((size_t)tries_size * 8 > (size_t)(end - p))
+                return;
+            p += tries_size * 8;
+            handlers = read_uleb128(&p, end);
+            while (handlers-- && p < end) {
+                catches = read_sleb128(&p, end);
+                for (pairs = abs(catches); pairs && p < end; pairs--) {
+                    read_uleb128(&p, end); /* type_idx */
+                    read_uleb128(&p, end); /* addr */
+                }
+                if (catches <= 0)
+                    read_uleb128(&p, end); /* catch_all_addr */
+            }
+        }
+    }
+}
+
+struct zip_entry {
+    char name[MAX_BLOB_PATH];
+    unsigned int method;
+    unsigned int compressed_size;
+    unsigned int size;
+    const unsigned char *data;
+};
+
+/* Find the end of central directory record, which sits at the very end of the archive, unless
+ * there's an archive comment (up to 64KB) after it.
+ */
+
+bool open_zip_archive(struct zip_archive *zip, const unsigned char *map, const unsigned char *end) {
+
+    const unsigned char *eocd;
+    unsigned int cd_off;
+
+    zip->map = map;
+    zip->end = end;
+
+    for (eocd = end - 22; eocd >= map && end - eocd <= 22 + 0xffff; eocd--) {
+        if (read_le32(eocd) != 0x06054b50)
+            continue;
+        zip->num_entries = read_le16(eocd + 10);
+        cd_off = read_le32(eocd + 16);
+        if (cd_off == 0xffffffff || cd_off > (size_t)(eocd - map)) /* zip64, or broken */
+            return false;
+        zip->central_directory = map + cd_off;
+        return true;
+    }
+    return false;
+}
+
+/* Parse the central directory header at cd into entry, and find where its data starts from the
+ * local header. Returns the next central directory header, or NULL once something is broken.
+ */
+
+const unsigned char *read_zip_entry(struct zip_archive *zip, const unsigned char *cd, struct zip_entry *entry) {
+
+    const unsigned char *local;
+    unsigned int name_len, extra_len, comment_len;
+
+    if (cd + 46 > zip->end || read_le32(cd) != 0x02014b50)
+        return NULL;
+
+    entry->method = read_le16(cd + 10);
+    entry->compressed_size = read_le32(cd + 20);
+    entry->size = read_le32(cd + 24);
+    name_len = read_le16(cd + 28);
+    extra_len = read_le16(cd + 30);
+    comment_len = read_le16(cd + 32);
+    if (cd + 46 + name_len > zip->end)
+        return NULL;
+
+    entry->name[0] = '\0';
+    if (name_len < sizeof(entry->name)) {
+        memcpy(entry->name, cd + 46, name_len);
+        entry->name[name_len] = '\0';
+    }
+
+    entry->data = NULL;
+    local = zip->map + read_le32(cd + 42);
+    if (local >= zip->map && local + 30 <= zip->end && read_le32(local) == 0x04034b50) {
+        local += 30 + read_le16(local + 26) + read_le16(local + 28);
+        if (local <= zip->end && entry->compressed_size <= (size_t)(zip->end - local))
+            entry->data = local;
+    }
+
+    return cd + 46 + name_len + extra_len + comment_len;
+}
+
+/* Hand back the uncompressed contents of an entry. Stored entries (which is how bundled libraries
+ * get packaged when they are loaded straight out of the apk) point right into the mapped archive,
+ * deflated ones get inflated in memory, straight out of the mapping.
+ */
+
+unsigned char *get_zip_entry_data(struct zip_entry *entry, bool *allocated) {
+
+#ifdef USE_ZLIB
+    z_stream stream;
+    unsigned char *out;
+    int ret;
+#endif
+
+    *allocated = false;
+    if (!entry->data)
+        return NULL;
+
+    if (entry->method == 0) {
+        if (entry->compressed_size != entry->size)
+            return NULL;
+        return (unsigned char *)entry->data;
+    }
+
+    if (entry->method != 8) {
+        fprintf(stderr, "warning: %s uses unknown compression method %u, skipping\n",
+                entry->name, entry->method);
+        return NULL;
+    }
+
+#ifdef USE_ZLIB
+    out = malloc(entry->size ? entry->size : 1);
+    if (!out)
+        return NULL;
+
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+    stream.next_in = (unsigned char *)entry->data;
+    stream.avail_in = entry->compressed_size;
+    stream.next_out = out;
+    stream.avail_out = entry->size;
+    ret = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END || stream.total_out != entry->size) {
+        fprintf(stderr, "warning: %s is broken, skipping\n", entry->name);
+        free(out);
+        return NULL;
+    }
+    *allocated = true;
+    return out;
+#else
+    fprintf(stderr, "warning: %s is compressed, rebuild with zlib to scan it\n", entry->name);
+    return NULL;
+#endif
+}
+
+bool is_zip_dex_entry(char *name) {
+
+    size_t len = strlen(name);
+
+    return !strncmp(name, dex_beginning, strlen(dex_beginning)) && !strchr(name, '/') &&
+            len > strlen(dex_ending) && !strcmp(name + len - strlen(dex_ending), dex_ending);
+}
+
+bool is_zip_lib_entry(char *name) {
+
+    size_t len = strlen(name);
+
+    return !strncmp(name, zip_lib_beginning, strlen(zip_lib_beginning)) &&
+            len > strlen(lib_ending) && !strcmp(name + len - strlen(lib_ending), lib_ending);
+}
+
+/* Check whether the archive carries its own copy of lib under lib/<abi>/ */
+
+bool zip_bundles_lib(struct zip_archive *zip, char *lib) {
+
+    struct zip_entry entry;
+    const unsigned char *cd;
+    unsigned int i;
+
+    cd = zip->central_directory;
+    for (i = 0; i < zip->num_entries && cd; i++) {
+        cd = read_zip_entry(zip, cd, &entry);
+        if (cd && is_zip_lib_entry(entry.name) && !strcmp(strrchr(entry.name, '/') + 1, lib))
+            return true;
+    }
+    return false;
+}
+
+/* Apks and jars don't get scanned as raw binaries, as their contents are mostly deflated. Instead
+ * we go through the zip's central directory and only look at the two things in there that can
+ * pull in native blobs: the libraries bundled under lib/<abi>/, which get scanned like any other
+ * library, and the classes*.dex files, which get searched for System.loadLibrary("foo") calls.
+ * While that goes on, the archive and its directory are remembered, so that the libraries it
+ * loads can also be found in its own lib/<arch>/ directory (Lollipop and up), or inside it.
+ * Nothing is ever extracted to disk.
+ */
+
+void zip_finder(char *filename, char *file_map, char *map_end) {
+
+    struct zip_archive zip;
+    struct zip_entry entry;
+    struct zip_archive *previous_zip;
+    char previous_app_directory[MAX_BLOB_PATH];
+    const unsigned char *cd;
+    unsigned char *data;
+    char *slash;
+    bool allocated;
+    unsigned int i;
+
+    if (!open_zip_archive(&zip, (unsigned char *)file_map, (unsigned char *)map_end)) {
+        fprintf(stderr, "warning: zip file %s is broken\n", filename);
+        return;
+    }
+
+    previous_zip = current_zip;
+    strcpy(previous_app_directory, current_app_directory);
+
+    current_zip = &zip;
+    current_app_directory[0] = '\0';
+    if (sdk_version >= 21 && !strncmp(filename, system_dump_root, strlen(system_dump_root)) &&
+            strlen(filename + strlen(system_dump_root)) < sizeof(current_app_directory)) {
+        strcpy(current_app_directory, filename + strlen(system_dump_root));
+        slash = strrchr(current_app_directory, '/');
+        if (slash)
+            slash[1] = '\0';
+        else
+            current_app_directory[0] = '\0';
+    }
+
+    cd = zip.central_directory;
+    for (i = 0; i < zip.num_entries && cd; i++) {
+        cd = read_zip_entry(&zip, cd, &entry);
+        if (!cd)
+            break;
+        if (!is_zip_lib_entry(entry.name) && !is_zip_dex_entry(entry.name))
+            continue;
+
+        data = get_zip_entry_data(&entry, &allocated);
+        if (!data)
+            continue;
+
+        if (is_zip_lib_entry(entry.name))
+            scan_blob_buffer((char *)data, (char *)data + entry.size);
+        else
+            dex_load_library_finder(data, entry.size);
+
+        if (allocated)
+            free(data);
+    }
+
+    current_zip = previous_zip;
+    strcpy(current_app_directory, previous_app_directory);
+}
+
+/* Purpose of this method is to open the blob by mmap-ing it, and hand it to scan_blob_buffer,
+ * or to zip_finder if it turns out to be an apk or jar.
  */
 
 bool dot_so_finder(char *filename) {
@@ -441,9 +1341,7 @@ bool dot_so_finder(char *filename) {
     int file_fd;
 
     char *file_map;
-    char *ptr;
-    char *prev;
-    off_t size;
+    char *map_end;
     struct stat file_stat;
 
     file_fd = open(filename, O_RDONLY);
@@ -453,27 +1351,23 @@ bool dot_so_finder(char *filename) {
     }
 
     fstat(file_fd, &file_stat);
+    if (file_stat.st_size == 0) {
+        close(file_fd);
+        return true;
+    }
 
     file_map = mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, file_fd, 0);
-
-    ptr = file_map;
-    prev = ptr;
-    size = file_stat.st_size;
-
-    while ((ptr = memmem(ptr, size, lib_ending, strlen(lib_ending))) != NULL) {
-
-        if (ptr >= file_map + file_stat.st_size)
-            break;
-
-        if (char_is_valid(ptr - 1))
-            get_full_lib_name(ptr);
-
-        size -= ptr - prev;
-        prev = ptr;
-
-        ptr++; /* Advance pointer one character to ensure we don't keep looping
-                  over the same ".so" instance over and over again */
+    if (file_map == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s!\n", filename);
+        close(file_fd);
+        return false;
     }
+    map_end = file_map + file_stat.st_size;
+
+    if (file_stat.st_size >= 4 && !memcmp(file_map, "PK\003\004", 4))
+        zip_finder(filename, file_map, map_end);
+    else
+        scan_blob_buffer(file_map, map_end);
 
     munmap(file_map, file_stat.st_size);
     close(file_fd);
@@ -543,6 +1437,7 @@ int main(int argc, char **argv) {
     char emulator_system_file[32], *sdkversionstr;
     size_t n;
     int num_files;
+    enum blob_kind kind;
     long length = 0;
     FILE *fp;
 
@@ -591,17 +1486,20 @@ int main(int argc, char **argv) {
 
         read_user_input(filename, sizeof(filename_buf), "File name?\n");
 
-        if (get_lib_from_system_dump(filename))
+        kind = classify_blob_name(filename) == BLOB_APP ? BLOB_APP : BLOB_LIB;
+
+        if (get_blob_from_system_dump(filename, kind))
         {
             last_slash = strrchr(filename, '/');
-            if (last_slash)
-                check_emulator_for_lib(++last_slash);
+            if (last_slash && kind == BLOB_LIB)
+                check_emulator_for_blob(++last_slash, kind);
             num_files--;
         }
     }
 
     fprintf(stderr, "Completed successfully.\n");
     free(sdk_buffer);
+    free(all_libs);
     argc = argc;
     argv = argv;
 
@@ -23,9 +23,11 @@
 
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdbool.h>
 
 #define MAX_LIB_NAME 50
-#define ALL_LIBS_SIZE 16384 /* 16KB */
+#define MAX_BLOB_PATH 128
+#define ALL_LIBS_SIZE 16384 /* 16KB to start with, grows as needed */
 
 /* #define DEBUG */
 
@@ -58,9 +60,162 @@ const char *blob_directories[] = {
     NULL
 };
 
+const char *firmware_directories[] = {
+    "/vendor/firmware/",
+    "/etc/firmware/",
+    "/vendor/etc/firmware/",
+    NULL
+};
+
+const char *config_directories[] = {
+    "/vendor/etc/",
+    "/etc/",
+    "/etc/permissions/",
+    "/vendor/etc/permissions/",
+    NULL
+};
+
+const char *script_directories[] = {
+    "/vendor/bin/",
+    "/bin/",
+    "/vendor/etc/",
+    "/etc/",
+    NULL
+};
+
+const char *app_directories[] = {
+    "/vendor/app/",
+    "/vendor/framework/",
+    "/priv-app/",
+    "/app/",
+    "/framework/",
+    NULL
+};
+
+/* Since Lollipop, the libraries bundled with a system app are extracted next to it, into
+ * /system/app/Foo/lib/<arch>/
+ */
+const char *app_lib_directories[] = {
+    "lib/arm/",
+    "lib/arm64/",
+    "lib/x86/",
+    "lib/x86_64/",
+    "lib/mips/",
+    "lib/mips64/",
+    NULL
+};
+
+/* Absolute references such as "/system/etc/foo.conf" are resolved as-is, relative to the dump root */
+const char *absolute_directories[] = {
+    "",
+    NULL
+};
+
 const char *lib_beginning = "lib";
 const char *egl_beginning = "egl";
 
 const char *lib_ending = ".so";
 
+const char *zip_lib_beginning = "lib/"; /* lib/<abi>/libfoo.so bundled inside an apk */
+const char *dex_beginning = "classes";
+const char *dex_ending = ".dex";
+
+/* System.loadLibrary("foo") loads libfoo.so */
+const char *load_library_class = "Ljava/lang/System;";
+const char *load_library_method = "loadLibrary";
+
+/* Width of each dex instruction in 16-bit code units, by opcode. The switch and array payloads,
+ * which hide behind nop (0x00), are sized separately.
+ */
+const unsigned char dex_insn_widths[256] = {
+    1, 1, 2, 3, 1, 2, 3, 1, 2, 3, 1, 1, 1, 1, 1, 1, /* 0x00 */
+    1, 1, 1, 2, 3, 2, 2, 3, 5, 2, 2, 3, 2, 1, 1, 2, /* 0x10 */
+    2, 1, 2, 2, 3, 3, 3, 1, 1, 2, 3, 3, 3, 2, 2, 2, /* 0x20 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, /* 0x30 */
+    1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x40 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x50 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, /* 0x60 */
+    3, 3, 3, 1, 3, 3, 3, 3, 3, 1, 1, 1, 1, 1, 1, 1, /* 0x70 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x80 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x90 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xa0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xb0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xc0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xd0 */
+    2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xe0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 4, 3, 3, 2, 2  /* 0xf0 */
+};
+
+/* Which register a dex instruction writes, by opcode, so that a const-string it overwrites is
+ * forgotten: 0 for none, 1 for vA (4 bits), 2 for vAA (8 bits), 3 for vAAAA (second code unit).
+ */
+const unsigned char dex_insn_dests[256] = {
+    0, 1, 2, 3, 1, 2, 3, 1, 2, 3, 2, 2, 2, 2, 0, 0, /* 0x00 */
+    0, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, /* 0x10 */
+    1, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, /* 0x20 */
+    2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x30 */
+    0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0, /* 0x40 */
+    0, 0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, /* 0x50 */
+    2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x60 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, /* 0x70 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x80 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x90 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xa0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xb0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xc0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xd0 */
+    2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xe0 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2  /* 0xf0 */
+};
+
+enum blob_kind {
+    BLOB_LIB,
+    BLOB_FIRMWARE,
+    BLOB_CONFIG,
+    BLOB_SCRIPT,
+    BLOB_ETC,
+    BLOB_APP,
+    BLOB_KIND_COUNT
+};
+
+const char *blob_kind_names[BLOB_KIND_COUNT] = {
+    "blob",
+    "firmware",
+    "config",
+    "script",
+    "etc",
+    "app"
+};
+
+const char **blob_kind_directories[BLOB_KIND_COUNT] = {
+    blob_directories,
+    firmware_directories,
+    config_directories,
+    script_directories,
+    config_directories,
+    app_directories
+};
+
+struct blob_pattern {
+    const char *pattern;
+    enum blob_kind kind;
+    bool prefix; /* pattern starts a path, rather than ending a file name */
+};
+
+/* Every pattern below is matched in a single pass over each blob, so adding one is cheap */
+const struct blob_pattern blob_patterns[] = {
+    { ".so",          BLOB_LIB,      false },
+    { ".mbn",         BLOB_FIRMWARE, false },
+    { ".b00",         BLOB_FIRMWARE, false },
+    { ".bin",         BLOB_FIRMWARE, false },
+    { ".xml",         BLOB_CONFIG,   false },
+    { ".conf",        BLOB_CONFIG,   false },
+    { ".cfg",         BLOB_CONFIG,   false },
+    { ".sh",          BLOB_SCRIPT,   false },
+    { ".apk",         BLOB_APP,      false },
+    { ".jar",         BLOB_APP,      false },
+    { "/system/etc/", BLOB_ETC,      true },
+    { NULL,           BLOB_LIB,      false }
+};
+
 #endif /* _ANDROID_BLOB_UTILITY_H_ */